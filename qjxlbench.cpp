@@ -0,0 +1,562 @@
+/* qjxlbench.cpp
+ *
+ * Decode benchmark for the plugin.  Loads the built plugin the same way Qt does, decodes
+ * every JXL file in a local corpus through QJxlHandler's read() and jumpToImage() paths
+ * and prints one JSON object per line, so results from two builds can be diffed.
+ * With --probe it instead times format detection over every file in the corpus, JXL or not.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <QtCore/QBuffer>
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDirIterator>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QPluginLoader>
+#include <QtGui/QImage>
+#include <QtGui/QImageIOPlugin>
+
+#include <jxl/decode_cxx.h>
+
+
+/* Count heap allocations made by anything in the process (Qt, the plugin, libjxl) by
+ * interposing glibc's malloc family.  operator new goes through malloc, so it's included. */
+static std::atomic<unsigned long long> allocationCount(0);
+
+#ifdef __GLIBC__
+#define QJXLBENCH_COUNT_ALLOCATIONS
+extern "C"
+{
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+
+// Read a "Field:  123 kB" line from /proc/self/status, or return -1.
+static qint64 procStatusKb(const char *field)
+{
+#ifdef Q_OS_LINUX
+    QFile status(QStringLiteral("/proc/self/status"));
+    if(status.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        while(!status.atEnd())
+        {
+            QByteArray line = status.readLine();
+            if(line.startsWith(field))
+                return line.mid(qstrlen(field)).trimmed().split(' ').value(0).toLongLong();
+        }
+    }
+#else
+    Q_UNUSED(field)
+#endif
+    return -1;
+}
+
+/* Reset the peak RSS counter (Linux only) and return the current RSS in KiB, so the caller can
+ * report how far the peak rose above what was already resident, or -1 if unknown. */
+static qint64 resetPeakRss()
+{
+#ifdef Q_OS_LINUX
+    QFile clearRefs(QStringLiteral("/proc/self/clear_refs"));
+    if(clearRefs.open(QIODevice::WriteOnly | QIODevice::Unbuffered) && clearRefs.write("5") == 1)
+        return procStatusKb("VmRSS:");
+#endif
+    return -1;
+}
+
+// Growth of the peak resident set size in KiB since resetPeakRss() returned baselineKb, or -1 if unknown.
+static qint64 peakRssGrowthKb(qint64 baselineKb)
+{
+    const qint64 peakKb = procStatusKb("VmHWM:");
+    if(baselineKb < 0 || peakKb < 0)
+        return -1;
+    return qMax<qint64>(0, peakKb - baselineKb);
+}
+
+
+// Properties of a corpus file, found by a separate lightweight libjxl pass.
+struct ImageInfo
+{
+    bool ok;
+    quint32 width;
+    quint32 height;
+    quint32 bitsPerSample;
+    bool alpha;
+    bool animated;
+    bool icc;              // Colorspace is only described by an ICC profile.
+    int frames;
+    qint64 basicInfoNs;    // Time for a bare libjxl decoder, not the plugin, to reach JXL_DEC_BASIC_INFO.
+};
+
+static ImageInfo probeImage(const QByteArray& data)
+{
+    ImageInfo info = {};
+
+    JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+    if(dec == nullptr ||
+       JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_BASIC_INFO | JXL_DEC_COLOR_ENCODING | JXL_DEC_FRAME) != JXL_DEC_SUCCESS)
+        return info;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if(JxlDecoderSetInput(dec.get(), (const uint8_t*)data.constData(), data.size()) != JXL_DEC_SUCCESS)
+        return info;
+
+    for(;;)
+    {
+        JxlBasicInfo basicInfo;
+        JxlColorEncoding colorEncoding;
+
+        switch(JxlDecoderProcessInput(dec.get()))
+        {
+        case JXL_DEC_BASIC_INFO:
+            info.basicInfoNs = timer.nsecsElapsed();
+            if(JxlDecoderGetBasicInfo(dec.get(), &basicInfo) != JXL_DEC_SUCCESS)
+                return info;
+            info.width = basicInfo.xsize;
+            info.height = basicInfo.ysize;
+            info.bitsPerSample = basicInfo.bits_per_sample;
+            info.alpha = basicInfo.alpha_bits > 0;
+            info.animated = basicInfo.have_animation;
+            break;
+
+        case JXL_DEC_COLOR_ENCODING:
+            info.icc = JxlDecoderGetColorAsEncodedProfile(dec.get(), nullptr, JXL_COLOR_PROFILE_TARGET_ORIGINAL, &colorEncoding) != JXL_DEC_SUCCESS;
+            break;
+
+        case JXL_DEC_FRAME:
+            info.frames++;
+            break;
+
+        case JXL_DEC_SUCCESS:
+            info.ok = info.frames > 0;
+            return info;
+
+        default:
+            return info;
+        }
+    }
+}
+
+
+enum class Mode
+{
+    Read,  // read() every frame in order, as QMovie does.
+    Jump,  // jumpToImage() backwards from the last frame, forcing a rewind for each one.
+};
+
+struct RunResult
+{
+    bool ok;
+    qint64 totalNs;
+    qint64 firstFrameNs;
+    unsigned long long allocations;
+    qint64 peakRssGrowthKb;
+};
+
+static RunResult runDecode(QImageIOPlugin& plugin, const QByteArray& data, Mode mode, int frames)
+{
+    RunResult result = {};
+
+    QBuffer buffer;
+    buffer.setData(data);
+    buffer.open(QIODevice::ReadOnly);
+
+    const qint64 rssBaselineKb = resetPeakRss();
+    const unsigned long long allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+    QElapsedTimer timer;
+    timer.start();
+
+    {
+        std::unique_ptr<QImageIOHandler> handler(plugin.create(&buffer, "jxl"));
+        if(handler == nullptr)
+            return result;
+
+        QImage image;
+        for(int i = 0; i < frames; i++)
+        {
+            if(mode == Mode::Jump && !handler->jumpToImage(frames - 1 - i))
+                return result;
+            if(!handler->read(&image))
+                return result;
+            if(i == 0)
+                result.firstFrameNs = timer.nsecsElapsed();
+        }
+    }
+
+    result.totalNs = timer.nsecsElapsed();
+    result.allocations = allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+    result.peakRssGrowthKb = peakRssGrowthKb(rssBaselineKb);
+    result.ok = true;
+    return result;
+}
+
+
+// The signature check as it was before QJxlHandler::hasJxlSignature(), for comparison.
+static QByteArray legacyReadableFormat(QIODevice& device)
+{
+    const int signatureBytes = 12;
+    QByteArray header = device.peek(signatureBytes);
+    if(header.size() != signatureBytes)
+    {
+        qInfo("Only got %dB from peek", header.size());
+        return {};
+    }
+
+    switch(JxlSignatureCheck((uint8_t*)header.constData(), header.size()))
+    {
+        case JXL_SIG_CODESTREAM:
+        case JXL_SIG_CONTAINER:
+            return "jxl";
+        default:
+            return {};
+    }
+}
+
+static void discardMessages(QtMsgType, const QMessageLogContext&, const QString&)
+{
+}
+
+enum class Probe
+{
+    Legacy,        // legacyReadableFormat(), as capabilities() used to call it.
+    Capabilities,  // QJxlPlugin::capabilities() alone.
+    Suffix,        // QImageReader finding us by a .jxl suffix: capabilities("jxl"), create("jxl"), canRead().
+    Content,       // QImageReader finding us by content: capabilities(""), create(""), canRead().
+};
+
+struct ProbeResult
+{
+    bool jxl;
+    qint64 totalNs;
+    unsigned long long allocations;
+};
+
+static ProbeResult runProbes(QImageIOPlugin& plugin, QIODevice& device, Probe probe, int count)
+{
+    ProbeResult result = {};
+
+    // The legacy check logs for short files; keep the formatting cost but not the noise
+    QtMessageHandler previousHandler = qInstallMessageHandler(discardMessages);
+
+    const unsigned long long allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+    QElapsedTimer timer;
+    timer.start();
+
+    for(int i = 0; i < count; i++)
+    {
+        switch(probe)
+        {
+        case Probe::Legacy:
+            result.jxl = legacyReadableFormat(device) == "jxl";
+            break;
+
+        case Probe::Capabilities:
+            result.jxl = plugin.capabilities(&device, QByteArray()).testFlag(QImageIOPlugin::CanRead);
+            break;
+
+        case Probe::Suffix:
+        case Probe::Content:
+        {
+            const QByteArray format = probe == Probe::Suffix ? QByteArray("jxl") : QByteArray();
+            result.jxl = plugin.capabilities(&device, format).testFlag(QImageIOPlugin::CanRead);
+            if(result.jxl)
+            {
+                std::unique_ptr<QImageIOHandler> handler(plugin.create(&device, format));
+                result.jxl = handler != nullptr && handler->canRead();
+            }
+            break;
+        }
+        }
+    }
+
+    result.totalNs = timer.nsecsElapsed();
+    result.allocations = allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+
+    qInstallMessageHandler(previousHandler);
+    return result;
+}
+
+
+static qint64 median(std::vector<qint64> values)
+{
+    if(values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+static void printRecord(const QJsonObject& record)
+{
+    const QByteArray line = QJsonDocument(record).toJson(QJsonDocument::Compact);
+    fwrite(line.constData(), 1, line.size(), stdout);
+    fputc('\n', stdout);
+    fflush(stdout);
+}
+
+static QStringList splitList(const QString& list)
+{
+    QStringList items;
+    for(const QString& item : list.split(QLatin1Char(',')))
+    {
+        if(!item.isEmpty())
+            items << item.trimmed();
+    }
+    return items;
+}
+
+// Expand the command line arguments into a sorted list of files matching nameFilters.
+static QStringList collectCorpus(const QStringList& paths, const QStringList& nameFilters)
+{
+    QStringList files;
+    for(const QString& path : paths)
+    {
+        if(QFileInfo(path).isDir())
+        {
+            QDirIterator it(path, nameFilters, QDir::Files, QDirIterator::Subdirectories);
+            while(it.hasNext())
+                files << it.next();
+        }
+        else
+        {
+            files << path;
+        }
+    }
+    files.sort();
+    return files;
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Decode benchmark for the JPEG XL image plugin.  Prints one JSON object per line."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("corpus"), QStringLiteral("JXL files, or directories to search for *.jxl (or for any file with --probe)."), QStringLiteral("corpus..."));
+    QCommandLineOption pluginOption(QStringLiteral("plugin"), QStringLiteral("Plugin library to load."), QStringLiteral("path"), QStringLiteral(QJXL_BENCH_PLUGIN_PATH));
+    QCommandLineOption threadsOption(QStringLiteral("threads"), QStringLiteral("Comma-separated worker thread counts to test (\"default\" lets libjxl decide)."), QStringLiteral("list"), QStringLiteral("default,0,1,4"));
+    QCommandLineOption iterationsOption(QStringLiteral("iterations"), QStringLiteral("Timed runs per file/mode/thread count."), QStringLiteral("n"), QStringLiteral("5"));
+    QCommandLineOption modesOption(QStringLiteral("modes"), QStringLiteral("Comma-separated decode paths to test: read, jump."), QStringLiteral("list"), QStringLiteral("read,jump"));
+    QCommandLineOption probeOption(QStringLiteral("probe"), QStringLiteral("Time format detection over all files in the corpus instead of decoding."));
+    QCommandLineOption probeCountOption(QStringLiteral("probe-count"), QStringLiteral("Probes per file and method with --probe."), QStringLiteral("n"), QStringLiteral("1000"));
+    parser.addOption(pluginOption);
+    parser.addOption(threadsOption);
+    parser.addOption(iterationsOption);
+    parser.addOption(modesOption);
+    parser.addOption(probeOption);
+    parser.addOption(probeCountOption);
+    parser.process(app);
+
+    const bool probeOnly = parser.isSet(probeOption);
+    const QStringList corpus = collectCorpus(parser.positionalArguments(),
+                                             probeOnly ? QStringList() : QStringList() << QStringLiteral("*.jxl"));
+    if(corpus.isEmpty())
+    {
+        qCritical("No corpus files given");
+        parser.showHelp(1);
+    }
+
+    const int iterations = qMax(1, parser.value(iterationsOption).toInt());
+    const QStringList threadCounts = splitList(parser.value(threadsOption));
+    const QStringList modes = splitList(parser.value(modesOption));
+
+    QPluginLoader loader(parser.value(pluginOption));
+    QImageIOPlugin *plugin = qobject_cast<QImageIOPlugin*>(loader.instance());
+    if(plugin == nullptr)
+    {
+        qCritical("Failed to load plugin: %s", qPrintable(loader.errorString()));
+        return 1;
+    }
+
+    const uint32_t jxlVersion = JxlDecoderVersion();
+    QJsonObject env;
+    env[QStringLiteral("type")] = QStringLiteral("env");
+    env[QStringLiteral("qt")] = QString::fromLatin1(qVersion());
+    env[QStringLiteral("libjxl")] = QStringLiteral("%1.%2.%3").arg(jxlVersion / 1000000).arg(jxlVersion / 1000 % 1000).arg(jxlVersion % 1000);
+    env[QStringLiteral("plugin")] = loader.fileName();
+#ifdef QJXLBENCH_COUNT_ALLOCATIONS
+    env[QStringLiteral("allocation_counting")] = true;
+#else
+    env[QStringLiteral("allocation_counting")] = false;
+#endif
+    printRecord(env);
+
+    int failures = 0;
+
+    if(probeOnly)
+    {
+        const int probeCount = qMax(1, parser.value(probeCountOption).toInt());
+        const Probe probes[] = { Probe::Legacy, Probe::Capabilities, Probe::Suffix, Probe::Content };
+        const char *probeNames[] = { "legacy", "capabilities", "suffix", "content" };
+
+        for(const QString& path : corpus)
+        {
+            QFile file(path);
+            if(!file.open(QIODevice::ReadOnly))
+            {
+                qWarning("Can't open %s", qPrintable(path));
+                failures++;
+                continue;
+            }
+
+            QJsonObject record;
+            record[QStringLiteral("type")] = QStringLiteral("probe");
+            record[QStringLiteral("file")] = path;
+            record[QStringLiteral("bytes")] = file.size();
+            record[QStringLiteral("probes")] = probeCount;
+
+            for(int i = 0; i < 4; i++)
+            {
+                const ProbeResult result = runProbes(*plugin, file, probes[i], probeCount);
+                const QString name = QString::fromLatin1(probeNames[i]);
+                record[name + QStringLiteral("_jxl")] = result.jxl;
+                record[name + QStringLiteral("_ns")] = (double)result.totalNs / probeCount;
+                record[name + QStringLiteral("_allocations")] = (double)result.allocations / probeCount;
+            }
+            printRecord(record);
+        }
+
+        return failures == 0 ? 0 : 2;
+    }
+
+    for(const QString& path : corpus)
+    {
+        QFile file(path);
+        if(!file.open(QIODevice::ReadOnly))
+        {
+            qWarning("Can't open %s", qPrintable(path));
+            failures++;
+            continue;
+        }
+        const QByteArray data = file.readAll();
+
+        const ImageInfo info = probeImage(data);
+        if(!info.ok)
+        {
+            qWarning("Can't probe %s", qPrintable(path));
+            failures++;
+            continue;
+        }
+
+        // Repeat the probe so time-to-basic-info gets the same treatment as the decodes.
+        // This is libjxl's own time; the plugin's buffering and setup aren't included.
+        std::vector<qint64> basicInfoNs;
+        for(int i = 0; i < iterations; i++)
+            basicInfoNs.push_back(probeImage(data).basicInfoNs);
+
+        const double megapixels = info.width * (double)info.height / 1e6;
+
+        for(const QString& modeName : modes)
+        {
+            Mode mode;
+            if(modeName == QLatin1String("read"))
+                mode = Mode::Read;
+            else if(modeName == QLatin1String("jump"))
+                mode = Mode::Jump;
+            else
+            {
+                qCritical("Unknown mode %s", qPrintable(modeName));
+                return 1;
+            }
+
+            // Jumping only makes sense for animations
+            if(mode == Mode::Jump && !info.animated)
+                continue;
+
+            // The jump mode rewinds for every frame, so it decodes n(n+1)/2 frames in total
+            const qint64 framesDecoded = mode == Mode::Jump ? (qint64)info.frames * (info.frames + 1) / 2 : info.frames;
+
+            for(const QString& threads : threadCounts)
+            {
+                if(threads == QLatin1String("default"))
+                    qunsetenv("QJXL_NUM_THREADS");
+                else
+                    qputenv("QJXL_NUM_THREADS", threads.toLatin1());
+
+                // Warm-up run, untimed
+                RunResult last = runDecode(*plugin, data, mode, info.frames);
+
+                std::vector<qint64> totalNs, firstFrameNs;
+                for(int i = 0; i < iterations && last.ok; i++)
+                {
+                    last = runDecode(*plugin, data, mode, info.frames);
+                    totalNs.push_back(last.totalNs);
+                    firstFrameNs.push_back(last.firstFrameNs);
+                }
+
+                const double totalMs = median(totalNs) / 1e6;
+
+                QJsonObject record;
+                record[QStringLiteral("type")] = QStringLiteral("decode");
+                record[QStringLiteral("file")] = path;
+                record[QStringLiteral("bytes")] = data.size();
+                record[QStringLiteral("width")] = (qint64)info.width;
+                record[QStringLiteral("height")] = (qint64)info.height;
+                record[QStringLiteral("bits_per_sample")] = (qint64)info.bitsPerSample;
+                record[QStringLiteral("alpha")] = info.alpha;
+                record[QStringLiteral("icc")] = info.icc;
+                record[QStringLiteral("animated")] = info.animated;
+                record[QStringLiteral("frames")] = info.frames;
+                record[QStringLiteral("mode")] = modeName;
+                record[QStringLiteral("threads")] = threads;
+                record[QStringLiteral("iterations")] = iterations;
+                record[QStringLiteral("ok")] = last.ok;
+                record[QStringLiteral("libjxl_basic_info_ms")] = median(basicInfoNs) / 1e6;
+                if(last.ok)
+                {
+                    record[QStringLiteral("total_ms")] = totalMs;
+                    record[QStringLiteral("total_ms_min")] = *std::min_element(totalNs.begin(), totalNs.end()) / 1e6;
+                    record[QStringLiteral("first_frame_ms")] = median(firstFrameNs) / 1e6;
+                    record[QStringLiteral("ms_per_mp")] = totalMs / (framesDecoded * megapixels);
+                    // Jumping decodes more frames than it delivers, so its rate gets a separate key
+                    if(info.animated && mode == Mode::Read)
+                        record[QStringLiteral("fps")] = info.frames / (totalMs / 1e3);
+                    else if(mode == Mode::Jump)
+                        record[QStringLiteral("decoded_fps")] = framesDecoded / (totalMs / 1e3);
+                    record[QStringLiteral("peak_rss_growth_kb")] = last.peakRssGrowthKb;
+                    record[QStringLiteral("allocations")] = (qint64)last.allocations;
+                }
+                else
+                {
+                    failures++;
+                }
+                printRecord(record);
+            }
+        }
+    }
+
+    return failures == 0 ? 0 : 2;
+}
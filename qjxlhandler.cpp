@@ -1,7 +1,11 @@
 /* qjxlhandler.cpp */
 
+#include <cmath>
 #include <limits>
 
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFileDevice>
+#include <QtCore/QLoggingCategory>
 #include <QtCore/QVariant>
 #include <QtCore/QSize>
 #include <QtGui/QImage>
@@ -17,6 +21,18 @@
 #define QJXLHANDLER_USE_ICC
 #endif
 
+/* Atlas frames are decoded straight into their cells, which relies on libjxl not padding the last row
+ * of an aligned output buffer, i.e. needing (ysize-1)*stride + row bytes.  Only enable it where libjxl
+ * reports a version of 0.7 or later. */
+#if defined(__has_include)
+#if __has_include(<jxl/version.h>)
+#include <jxl/version.h>
+#endif
+#endif
+#if defined(JPEGXL_NUMERIC_VERSION) && JPEGXL_NUMERIC_VERSION >= ((0 << 24) | (7 << 16))
+#define QJXLHANDLER_USE_ATLAS
+#endif
+
 // Suppress gcc switch fallthrough warnings
 #ifdef __GNUC__
 #define QJXLHANDLER_FALLTHROUGH __attribute__ ((fallthrough));
@@ -24,6 +40,21 @@
 #define QJXLHANDLER_FALLTHROUGH
 #endif
 
+// Largest atlas we'll allocate before Qt 6, where QImageReader::allocationLimit() takes over.
+// Matches Qt 6's default limit.
+#define QJXLHANDLER_MAX_ATLAS_BYTES (256LL * 1024 * 1024)
+
+// Chatter from normal operation; hidden unless debug output is enabled for the category.
+Q_LOGGING_CATEGORY(lcJxl, "qt.imageformats.jxl", QtInfoMsg)
+/* Off by default.  Enabling info output turns on phase timing and attaches the DecodeStats to each image
+ * read() returns; enabling debug output as well logs a summary line after each read(). */
+Q_LOGGING_CATEGORY(lcJxlStats, "qt.imageformats.jxl.stats", QtWarningMsg)
+
+static inline bool statsEnabled()
+{
+    return lcJxlStats().isInfoEnabled();
+}
+
 
 /* The libjxl *_cxx.h headers define functions so I can't include them in qjxlhandler.h without linker errors.
  * So all the Jxl objects are defined in this source file. */
@@ -45,6 +76,44 @@ struct QJxlState
     int nextFrame;                      // Next frame Qt wants (implicit or via jumpToImage or jumpToNextImage).
 
     QByteArray fileData;                // Buffered input file.
+
+    qint64 frameNs;                     // Time spent so far decoding the current frame.
+
+    // While decoding an atlas, frames are written straight into its cells instead of into pixels.
+    uint8_t *atlasBits;                 // First byte of the atlas image, or nullptr when not decoding one.
+    size_t atlasLength;                 // Size of the atlas in bytes.
+    size_t atlasStride;                 // Bytes per atlas row.
+    size_t atlasCellStride;             // Bytes per row of one frame.
+    int atlasColumns;                   // Frames per atlas row.
+};
+
+
+// Adds the time spent in a scope to a DecodeStats timing, if timing is enabled.
+class PhaseTimer
+{
+public:
+    explicit PhaseTimer(qint64 *total) :
+        _total(statsEnabled() ? total : nullptr)
+    {
+        if(_total)
+            _timer.start();
+    }
+
+    ~PhaseTimer()
+    {
+        stop();
+    }
+
+    void stop()
+    {
+        if(_total)
+            *_total += _timer.nsecsElapsed();
+        _total = nullptr;
+    }
+
+private:
+    qint64 *_total;
+    QElapsedTimer _timer;
 };
 
 
@@ -63,11 +132,121 @@ inline static bool subscribeEvents(JxlDecoder *dec)
     return true;
 }
 
+// Find the QImage format matching the samples libjxl is producing.
+static bool qtFormatFor(const JxlPixelFormat& pixelFormat, QImage::Format *qtPixelFormat, unsigned *bytesPerSample)
+{
+    if(pixelFormat.data_type == JXL_TYPE_UINT8)
+    {
+        *bytesPerSample = 1;
+        *qtPixelFormat = QImage::Format_RGBA8888;
+        return true;
+    }
+    if(pixelFormat.data_type == JXL_TYPE_UINT16)
+    {
+        *bytesPerSample = 2;
+        *qtPixelFormat = QImage::Format_RGBA64;
+        return true;
+    }
+    return false;
+}
+
+// Tell the QImage the colorspace of the pixels.
+static void setColorSpace(QImage *image, const QByteArray& iccProfile)
+{
+#ifdef QJXLHANDLER_USE_ICC
+    if(!iccProfile.isEmpty())
+    {
+        QColorSpace cs = QColorSpace::fromIccProfile(iccProfile);
+        if(cs.isValid())
+            image->setColorSpace(cs);
+        else
+            qWarning("Embedded colorspace unsupported; falling back on sRGB");
+    }
+#else
+    Q_UNUSED(image)
+    Q_UNUSED(iccProfile)
+#endif
+}
+
+#ifdef QJXLHANDLER_USE_ATLAS
+// Count the frames and collect their durations from the frame headers alone, without decoding any pixels.
+static bool scanFrames(const QByteArray& fileData, float msPerTick, QVector<int> *durationsMs)
+{
+    JxlDecoderPtr dec = JxlDecoderMake(nullptr);
+    if(dec == nullptr || JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_FRAME) != JXL_DEC_SUCCESS)
+    {
+        qWarning("Failed to create JxlDecoder for frame scan");
+        return false;
+    }
+    if(JxlDecoderSetInput(dec.get(), (const uint8_t*)fileData.constData(), fileData.size()) != JXL_DEC_SUCCESS)
+    {
+        qWarning("Failed in JxlDecoderSetInput");
+        return false;
+    }
+
+    durationsMs->clear();
+    for(;;)
+    {
+        JxlFrameHeader frameHeader;
+        switch(JxlDecoderProcessInput(dec.get()))
+        {
+        case JXL_DEC_FRAME:
+            if(JxlDecoderGetFrameHeader(dec.get(), &frameHeader) != JXL_DEC_SUCCESS)
+            {
+                qWarning("Failed in JxlDecoderGetFrameHeader");
+                return false;
+            }
+            durationsMs->append((int)(msPerTick * frameHeader.duration));
+            break;
+
+        case JXL_DEC_SUCCESS:
+            return !durationsMs->isEmpty();
+
+        default:
+            qWarning("Failed to scan frame headers");
+            return false;
+        }
+    }
+}
+#endif
+
+// Point the decoder at the next frame's cell in the atlas.  The atlas stride is passed as the row alignment,
+// so libjxl steps over the neighbouring cells and each row lands in place.
+static bool setAtlasOutBuffer(QJxlState& state)
+{
+    const int frame = state.currentImageNumber + 1;
+
+    JxlPixelFormat cellFormat = state.pixelFormat;
+    cellFormat.align = state.atlasStride;
+
+    // From the start of the cell to the end of its last row, not counting the neighbouring cells after it
+    const size_t cellLength = (state.basicInfo.ysize - 1) * state.atlasStride + state.atlasCellStride;
+
+    const size_t offset = (size_t)(frame / state.atlasColumns) * state.basicInfo.ysize * state.atlasStride +
+                          (size_t)(frame % state.atlasColumns) * state.atlasCellStride;
+    if(offset + cellLength > state.atlasLength)
+    {
+        qWarning("Frame %d doesn't fit in the atlas", frame);
+        return false;
+    }
+
+    if(JxlDecoderSetImageOutBuffer(state.dec.get(), &cellFormat, state.atlasBits + offset, cellLength) != JXL_DEC_SUCCESS)
+    {
+        qWarning("Failed in JxlDecoderSetImageOutBuffer");
+        return false;
+    }
+    return true;
+}
+
 
 QJxlHandler::QJxlHandler() :
     QImageIOHandler(),
     _state(nullptr),
-    _progress(Invalid)
+    _progress(Invalid),
+    _stats(),
+    _atlas(false),
+    _verifiedDevice(nullptr),
+    _verifiedPos(-1)
 {
     /* QImageIOHandler is sometimes instantiated and destroyed just to call canRead(),
      * so don't work too hard in the constructor.  Decoder initialization is deferred until
@@ -80,10 +259,16 @@ void QJxlHandler::_init()
     if(_progress != Invalid)
         return;
 
+    // QJXL_NUM_THREADS lets users cap the decoder's threads, e.g. for thumbnailers that decode many files at once.
+    // The lookup is negligible next to starting the thread pool.
+    size_t numThreads = JxlThreadParallelRunnerDefaultNumWorkerThreads();
+    if(qEnvironmentVariableIsSet("QJXL_NUM_THREADS"))
+        numThreads = qMax(0, qEnvironmentVariableIntValue("QJXL_NUM_THREADS"));
+
     _state.reset(new QJxlState
     {
         .dec = JxlDecoderMake(nullptr),
-        .runner = JxlThreadParallelRunnerMake(nullptr, JxlThreadParallelRunnerDefaultNumWorkerThreads()),
+        .runner = JxlThreadParallelRunnerMake(nullptr, numThreads),
         // Default to 8-bit sampling.  Changes to 16-bit later if required.
         .pixelFormat = {
                           .num_channels = 4, // 3 colors + alpha
@@ -94,6 +279,7 @@ void QJxlHandler::_init()
         .currentImageNumber = -1,
         .imageCount = -1,
         .nextFrame = 0,
+        .frameNs = 0,
     });
 
     if(_state == nullptr)         return (void)qWarning("Failed to create state object");
@@ -114,10 +300,21 @@ bool QJxlHandler::isInitialized() const
     return _progress > Invalid;
 }
 
+void QJxlHandler::setAtlas(bool atlas)
+{
+    _atlas = atlas;
+}
+
+const QJxlHandler::DecodeStats& QJxlHandler::decodeStats() const
+{
+    return _stats;
+}
+
 
 
 bool QJxlHandler::_rewind()
 {
+    _stats.rewinds++;
     JxlDecoderReset(_state->dec.get());
 
     if(JxlDecoderSetParallelRunner(_state->dec.get(), JxlThreadParallelRunner, _state->runner.get()) != JXL_DEC_SUCCESS)
@@ -140,6 +337,7 @@ bool QJxlHandler::_rewind()
     }
     _state->currentFrameDurationMs = 0;
     _state->currentImageNumber = -1;
+    _state->frameNs = 0;
     //_state->imageCount  // Keep this populated
     _state->nextFrame = 0; // TODO: don't want to reset this if we're wrapping around to find the requested frame
     return true;
@@ -157,15 +355,26 @@ bool QJxlHandler::canRead() const
     if (!device() || !device()->isReadable())
         return false;
 
-    QByteArray mimeFormat = getReadableFormat(*device());
-
-    if(mimeFormat.isEmpty())
+    // Skip the signature check if it's already been done here, e.g. by the plugin before creating us
+    const bool verified = device() == _verifiedDevice && !device()->isSequential() && device()->pos() == _verifiedPos;
+    if(!verified && !hasJxlSignature(*device(), &_stats.probeNs))
         return false;
 
-    setFormat("jxl");
+    setFormat(QByteArrayLiteral("jxl"));
     return true;
 }
 
+void QJxlHandler::setSignatureVerified(qint64 probeNs)
+{
+    _stats.probeNs += probeNs;
+
+    if(device() == nullptr || device()->isSequential())
+        return;
+
+    _verifiedDevice = device();
+    _verifiedPos = device()->pos();
+}
+
 int QJxlHandler::currentImageNumber() const
 {
     if(_progress < HaveBasicInfo)
@@ -182,10 +391,14 @@ QRect QJxlHandler::currentImageRect() const
 
 int QJxlHandler::imageCount() const
 {
+    // read() returns all the frames as one image
+    if(_atlas)
+        return 1;
+
     // libjxl doesn't seem to provide this without us decoding every frame
     if(_progress == Invalid || _state->imageCount == -1)
     {
-        qWarning("Request for image count but we haven't counted them yet");
+        qCDebug(lcJxl, "Request for image count but we haven't counted them yet");
         return 0;
     }
     return _state->imageCount;
@@ -193,6 +406,11 @@ int QJxlHandler::imageCount() const
 
 bool QJxlHandler::jumpToImage(int imageNumber)
 {
+    if(_progress < HaveState)
+        _init();
+    if(_progress < HaveState)
+        return false;
+
     if(_progress >= HaveBasicInfo && !_state->basicInfo.have_animation)
     {
         qWarning("Jumping to frame %d but this isn't an animation", imageNumber);
@@ -204,14 +422,16 @@ bool QJxlHandler::jumpToImage(int imageNumber)
         return false;
     }
 
-    _state->nextFrame = imageNumber;
-
     if(imageNumber <= _state->currentImageNumber)
     {
         // To get a previous frame, have to start decoding from the beginning
-        _rewind();
+        if(!_rewind())
+            return false;
     }
 
+    // Set this after rewinding, which resets it to 0
+    _state->nextFrame = imageNumber;
+
     return true;
 }
 
@@ -255,12 +475,16 @@ int QJxlHandler::nextImageDelay() const
 
 QVariant QJxlHandler::option(ImageOption opt) const
 {
+    // An atlas is a single still image, whatever the file holds
+    if(_atlas && opt == ImageOption::Animation)
+        return false;
+
     if(_progress < HaveBasicInfo &&
          (/*opt == ImageOption::Size || */
           opt == ImageOption::Animation)
       )
     {
-        qWarning("Unable to provide option %d before basic info is available", (int)opt);
+        qCDebug(lcJxl, "Unable to provide option %d before basic info is available", (int)opt);
         return {};
     }
 
@@ -271,7 +495,7 @@ QVariant QJxlHandler::option(ImageOption opt) const
     case ImageOption::Animation:
         return _state->basicInfo.have_animation;
     default:
-        qWarning("Request for unsupported option %d", (int)opt);
+        qCDebug(lcJxl, "Request for unsupported option %d", (int)opt);
         return {};
     }
 }
@@ -288,6 +512,9 @@ bool QJxlHandler::read(QImage* destImage)
     if(_progress < HaveState)
       _init();
 
+    if(_atlas)
+        return _readAtlas(destImage);
+
     // Run the decoder until we have frame index _state->nextFrame in _state->pixels
     ReadUntil result = _readUntil(ReadUntil::NextFrameDecoded);
     if(result != ReadUntil::NextFrameDecoded && result != ReadUntil::End)
@@ -312,23 +539,14 @@ bool QJxlHandler::read(QImage* destImage)
     unsigned bytesPerSample;
     QImage::Format qtPixelFormat;
 
-    if(_state->pixelFormat.data_type == JXL_TYPE_UINT8)
-    {
-        bytesPerSample = 1;
-        qtPixelFormat = QImage::Format_RGBA8888;
-    }
-    else if(_state->pixelFormat.data_type == JXL_TYPE_UINT16)
-    {
-        bytesPerSample = 2;
-        qtPixelFormat = QImage::Format_RGBA64;
-
-    }
-    else
+    if(!qtFormatFor(_state->pixelFormat, &qtPixelFormat, &bytesPerSample))
     {
         qWarning("Pixel format isn't set correctly");
         return false;
     }
 
+    PhaseTimer handoffTimer(&_stats.handoffNs);
+
     int stride = _state->basicInfo.xsize * _state->pixelFormat.num_channels * bytesPerSample;
 
     // Create the image and transfer pixel ownership to Qt
@@ -336,19 +554,166 @@ bool QJxlHandler::read(QImage* destImage)
     *destImage = QImage(pixelPtr, static_cast<int>(_state->basicInfo.xsize), static_cast<int>(_state->basicInfo.ysize),
                         stride, qtPixelFormat, [](void* img) { delete [] (uint8_t*)img; }, pixelPtr);
 
-#ifdef QJXLHANDLER_USE_ICC
-    // Tell the QImage the colorspace of the pixels
-    if(!_state->iccProfile.isEmpty())
+    setColorSpace(destImage, _state->iccProfile);
+
+    handoffTimer.stop();
+
+    if(statsEnabled())
+        _attachStats(destImage);
+    if(lcJxlStats().isDebugEnabled())
+        _logStats();
+
+    return true;
+}
+
+
+bool QJxlHandler::_readAtlas(QImage* destImage)
+{
+#ifndef QJXLHANDLER_USE_ATLAS
+    Q_UNUSED(destImage)
+    qWarning("Atlas decoding needs libjxl 0.7 or later");
+    return false;
+#else
+    if(_readUntil(ReadUntil::BasicInfoAvailable) != ReadUntil::BasicInfoAvailable)
     {
-        QColorSpace cs = QColorSpace::fromIccProfile(QByteArray((const char*)_state->iccProfile.constData(), _state->iccProfile.size()));
-        if(cs.isValid())
-            destImage->setColorSpace(cs);
-        else
-            qWarning("Embedded colorspace unsupported; falling back on sRGB");
+        qWarning("Failed to read basic info");
+        return false;
+    }
+
+    QVector<int> durationsMs;
+    if(!scanFrames(_state->fileData, _state->basicInfo.have_animation ? _state->msPerTick : 0, &durationsMs))
+        return false;
+    const int frames = durationsMs.size();
+    _state->imageCount = frames;
+
+    unsigned bytesPerSample;
+    QImage::Format qtPixelFormat;
+    if(!qtFormatFor(_state->pixelFormat, &qtPixelFormat, &bytesPerSample))
+    {
+        qWarning("Pixel format isn't set correctly");
+        return false;
+    }
+
+    // Lay the frames out left to right, top to bottom, in a roughly square grid
+    const int columns = (int)std::ceil(std::sqrt((double)frames));
+    const int rows = (frames + columns - 1) / columns;
+    const qint64 frameWidth = _state->basicInfo.xsize;
+    const qint64 frameHeight = _state->basicInfo.ysize;
+    if(frameWidth * columns > std::numeric_limits<int>::max() || frameHeight * rows > std::numeric_limits<int>::max())
+    {
+        qWarning("Atlas of %d x %d frames is too large", columns, rows);
+        return false;
+    }
+
+    const QSize atlasSize((int)(frameWidth * columns), (int)(frameHeight * rows));
+    QImage atlas;
+#if QT_VERSION >= 0x060000
+    // Honours QImageReader::allocationLimit()
+    if(!QImageIOHandler::allocateImage(atlasSize, qtPixelFormat, &atlas))
+    {
+        qWarning("Failed to allocate %d x %d atlas", atlasSize.width(), atlasSize.height());
+        return false;
+    }
+#else
+    const qint64 bytesPerPixel = _state->pixelFormat.num_channels * bytesPerSample;
+    if((qint64)atlasSize.width() * atlasSize.height() > QJXLHANDLER_MAX_ATLAS_BYTES / bytesPerPixel)
+    {
+        qWarning("Atlas of %d x %d pixels would exceed %lld B", atlasSize.width(), atlasSize.height(), QJXLHANDLER_MAX_ATLAS_BYTES);
+        return false;
+    }
+    atlas = QImage(atlasSize, qtPixelFormat);
+    if(atlas.isNull())
+    {
+        qWarning("Failed to allocate %d x %d atlas", atlasSize.width(), atlasSize.height());
+        return false;
     }
 #endif
+    _stats.bufferAllocations++;
+
+    // Cells after the last frame would otherwise be uninitialized
+    if(frames < columns * rows)
+        atlas.fill(Qt::transparent);
+
+    // Start again from frame 0, unless we haven't got that far yet
+    if(_state->currentImageNumber >= 0 && !_rewind())
+        return false;
+
+    _state->atlasBits = atlas.bits();
+    _state->atlasLength = (size_t)atlas.bytesPerLine() * atlas.height();
+    _state->atlasStride = atlas.bytesPerLine();
+    _state->atlasCellStride = _state->basicInfo.xsize * _state->pixelFormat.num_channels * bytesPerSample;
+    _state->atlasColumns = columns;
+
+    ReadUntil result = _readUntil(ReadUntil::End);
+
+    _state->atlasBits = nullptr;
+
+    if(result != ReadUntil::End || _state->currentImageNumber + 1 != frames)
+    {
+        qWarning("Failed to decode all %d frames into the atlas", frames);
+        return false;
+    }
+
+    PhaseTimer handoffTimer(&_stats.handoffNs);
+
+    // Describe the layout so the caller can blit frames straight out of the atlas
+    atlas.setText(QStringLiteral("JxlAtlasFrames"), QString::number(frames));
+    atlas.setText(QStringLiteral("JxlAtlasColumns"), QString::number(columns));
+    atlas.setText(QStringLiteral("JxlAtlasRows"), QString::number(rows));
+    atlas.setText(QStringLiteral("JxlAtlasLoopCount"), QString::number(loopCount()));
+    for(int i = 0; i < frames; i++)
+    {
+        atlas.setText(QStringLiteral("JxlAtlasFrame%1").arg(i),
+                      QStringLiteral("%1,%2,%3,%4,%5").arg(i % columns * frameWidth).arg(i / columns * frameHeight)
+                                                      .arg(frameWidth).arg(frameHeight).arg(durationsMs[i]));
+    }
+
+    setColorSpace(&atlas, _state->iccProfile);
+
+    *destImage = atlas;
+
+    handoffTimer.stop();
+
+    if(statsEnabled())
+        _attachStats(destImage);
+    if(lcJxlStats().isDebugEnabled())
+        _logStats();
 
     return true;
+#endif
+}
+
+void QJxlHandler::_logStats() const
+{
+    QFileDevice *file = qobject_cast<QFileDevice*>(device());
+    const int frame = _state->currentImageNumber;
+
+    qCDebug(lcJxlStats, "%s frame %d: decode %.3f ms, hand-off %.3f ms; totals: probe %.3f ms, input %.3f ms (%lld B), "
+                        "basic info %.3f ms, ICC %.3f ms, %d frames, %d buffer allocations, %d rewinds",
+            file ? qPrintable(file->fileName()) : "(device)", frame,
+            _stats.frameNs.value(frame) / 1e6, _stats.handoffNs / 1e6, _stats.probeNs / 1e6, _stats.inputReadNs / 1e6,
+            _stats.bytesRead, _stats.basicInfoNs / 1e6, _stats.iccNs / 1e6,
+            _stats.framesDecoded, _stats.bufferAllocations, _stats.rewinds);
+}
+
+void QJxlHandler::_attachStats(QImage* image) const
+{
+    /* Attached to every image rather than offered as the Description option, because QImageReader
+     * only fetches Description once and would keep returning the first frame's figures. */
+    QString frames;
+    for(qint64 ns : _stats.frameNs)
+        frames += (frames.isEmpty() ? QString() : QStringLiteral(",")) + QString::number(ns);
+
+    image->setText(QStringLiteral("JxlProbeNs"), QString::number(_stats.probeNs));
+    image->setText(QStringLiteral("JxlInputReadNs"), QString::number(_stats.inputReadNs));
+    image->setText(QStringLiteral("JxlBasicInfoNs"), QString::number(_stats.basicInfoNs));
+    image->setText(QStringLiteral("JxlIccNs"), QString::number(_stats.iccNs));
+    image->setText(QStringLiteral("JxlFrameNs"), frames);
+    image->setText(QStringLiteral("JxlHandoffNs"), QString::number(_stats.handoffNs));
+    image->setText(QStringLiteral("JxlBytesRead"), QString::number(_stats.bytesRead));
+    image->setText(QStringLiteral("JxlFramesDecoded"), QString::number(_stats.framesDecoded));
+    image->setText(QStringLiteral("JxlBufferAllocations"), QString::number(_stats.bufferAllocations));
+    image->setText(QStringLiteral("JxlRewinds"), QString::number(_stats.rewinds));
 }
 
 
@@ -369,7 +734,11 @@ QJxlHandler::ReadUntil QJxlHandler::_readUntil(QJxlHandler::ReadUntil until)
             qWarning("Read attempted out of sequence - device is not set");
             return ReadUntil::Error;
         }
-        _state->fileData = device()->readAll();
+        {
+            PhaseTimer timer(&_stats.inputReadNs);
+            _state->fileData = device()->readAll();
+        }
+        _stats.bytesRead += _state->fileData.size();
 
         if(JxlDecoderSetInput(dec, (const uint8_t*)_state->fileData.constData(), _state->fileData.size()) != JXL_DEC_SUCCESS)
         {
@@ -407,6 +776,20 @@ QJxlHandler::ReadUntil QJxlHandler::_readUntil(QJxlHandler::ReadUntil until)
 
     JxlDecoderStatus decoderStatus;
 
+    // Decoder time between events is charged to the phase that each event completes
+    const bool timing = statsEnabled();
+    QElapsedTimer lap;
+    if(timing)
+        lap.start();
+    auto lapNs = [&]() -> qint64
+    {
+        if(!timing)
+            return 0;
+        qint64 ns = lap.nsecsElapsed();
+        lap.start();
+        return ns;
+    };
+
     // Start decoding, handling interesting events along the way
     while((decoderStatus = JxlDecoderProcessInput(dec)) != JXL_DEC_SUCCESS)
     {
@@ -414,6 +797,8 @@ QJxlHandler::ReadUntil QJxlHandler::_readUntil(QJxlHandler::ReadUntil until)
       switch(decoderStatus)
       {
       case JXL_DEC_BASIC_INFO:
+          _stats.basicInfoNs += lapNs();
+
           if(_progress >= HaveBasicInfo)
           {
               // Cautiously discard any buffered pixels
@@ -459,6 +844,7 @@ QJxlHandler::ReadUntil QJxlHandler::_readUntil(QJxlHandler::ReadUntil until)
             if (JxlDecoderGetICCProfileSize(dec, &_state->pixelFormat, JXL_COLOR_PROFILE_TARGET_DATA, &icc_size) != JXL_DEC_SUCCESS)
             {
                 qWarning("Failed in JxlDecoderGetICCProfileSize");
+                _stats.iccNs += lapNs();
                 continue;
             }
             _state->iccProfile.resize(icc_size);
@@ -466,13 +852,24 @@ QJxlHandler::ReadUntil QJxlHandler::_readUntil(QJxlHandler::ReadUntil until)
             {
                 qWarning("Failed in JxlDecoderGetColorAsICCProfile");
                 _state->iccProfile = "";
+                _stats.iccNs += lapNs();
                 continue;
             }
 
+            // Includes extracting the profile, not just the decoder's work to reach this event
+            _stats.iccNs += lapNs();
             break;
 #endif
 
         case JXL_DEC_NEED_IMAGE_OUT_BUFFER:
+            _state->frameNs += lapNs();
+
+            if(_state->atlasBits != nullptr)
+            {
+                if(!setAtlasOutBuffer(*_state))
+                    return ReadUntil::Error;
+                break;
+            }
 
             // Time to allocate some space for the pixels
             if (JxlDecoderImageOutBufferSize(dec, &_state->pixelFormat, &_state->pixelsLength) != JXL_DEC_SUCCESS )
@@ -500,10 +897,11 @@ QJxlHandler::ReadUntil QJxlHandler::_readUntil(QJxlHandler::ReadUntil until)
                     qWarning("Failed to allocate %zu B", _state->pixelsLength);
                     return ReadUntil::Error;
                 }
+                _stats.bufferAllocations++;
             }
             else
             {
-                qWarning("Overwriting previously buffered pixels");
+                qCDebug(lcJxl, "Overwriting previously buffered pixels");
             }
             
             if (JxlDecoderSetImageOutBuffer(dec, &_state->pixelFormat, _state->pixels.get(), _state->pixelsLength) != JXL_DEC_SUCCESS)
@@ -514,6 +912,8 @@ QJxlHandler::ReadUntil QJxlHandler::_readUntil(QJxlHandler::ReadUntil until)
             break;
 
         case JXL_DEC_FRAME:
+            _state->frameNs += lapNs();
+
             // Start of frame - can extract duration etc.
             if(_state->basicInfo.have_animation)
             {
@@ -537,6 +937,16 @@ QJxlHandler::ReadUntil QJxlHandler::_readUntil(QJxlHandler::ReadUntil until)
 
             _state->currentImageNumber ++;
 
+            _stats.framesDecoded++;
+            if(timing)
+            {
+                // Only grown while timing, so there's no allocation cost otherwise
+                if(_stats.frameNs.size() <= _state->currentImageNumber)
+                    _stats.frameNs.resize(_state->currentImageNumber + 1);
+                _stats.frameNs[_state->currentImageNumber] = _state->frameNs + lapNs();
+            }
+            _state->frameNs = 0;
+
             if(until == ReadUntil::NextFrameDecoded)
             {
                 if(_state->nextFrame == _state->currentImageNumber)
@@ -578,7 +988,7 @@ QJxlHandler::ReadUntil QJxlHandler::_readUntil(QJxlHandler::ReadUntil until)
 void QJxlHandler::setOption(ImageOption opt, const QVariant& value)
 {
     Q_UNUSED(value)
-    qWarning("Caller tried to set unsupported option %d", (int)opt);
+    qCDebug(lcJxl, "Caller tried to set unsupported option %d", (int)opt);
 }
 
 bool QJxlHandler::supportsOption(ImageOption option) const
@@ -594,28 +1004,24 @@ bool QJxlHandler::supportsOption(ImageOption option) const
 
 
 
-QByteArray QJxlHandler::getReadableFormat(QIODevice& device)
+bool QJxlHandler::hasJxlSignature(QIODevice& device, qint64 *probeNs)
 {
-    const int signatureBytes = 12;
-    QByteArray header = device.peek(signatureBytes);
-    if(header.size() != signatureBytes)
-    {
-        qInfo("Only got %dB from peek", header.size());
-        return {};
-    }
+    PhaseTimer timer(probeNs);
+
+    /* This runs for every file Qt auto-detects, whatever its format, so it peeks into a stack
+     * buffer and stays quiet.  12 bytes covers the container signature; a bare codestream
+     * only needs 2, and anything shorter than that can't be JXL. */
+    uint8_t header[12];
+    const qint64 got = device.peek(reinterpret_cast<char*>(header), sizeof(header));
+    if(got < 2)
+        return false;
 
-    switch(JxlSignatureCheck((uint8_t*)header.constData(), header.size()))
+    switch(JxlSignatureCheck(header, static_cast<size_t>(got)))
     {
-        case JXL_SIG_NOT_ENOUGH_BYTES:
-            qWarning("Signature check wants more than 12 bytes");
-            return {};
-        case JXL_SIG_INVALID:
-            //qWarning("Signature invalid");
-            return {};
         case JXL_SIG_CODESTREAM:
         case JXL_SIG_CONTAINER:
-            return "jxl";
+            return true;
+        default:
+            return false;
     }
-
-    return {};
 }
@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <QImageIOHandler>
+#include <QVector>
 
 
 struct QJxlState;
@@ -26,9 +27,36 @@ public:
     virtual void setOption(ImageOption option, const QVariant &value) override;
     virtual bool supportsOption(ImageOption option) const override;
 
-    static QByteArray getReadableFormat(QIODevice& device);
+    // Checks for a codestream or container signature at the device's current position, without allocating or logging.
+    // If probeNs is given, the time taken is added to it while stats are being collected.
+    static bool hasJxlSignature(QIODevice& device, qint64 *probeNs = nullptr);
+    // Records that the device has already passed hasJxlSignature() at its current position, so canRead() needn't
+    // check again, and adds the time that check took to the probe stats.
+    void setSignatureVerified(qint64 probeNs = 0);
     bool isInitialized() const;
 
+    // Make read() decode every frame into a single atlas image.  The plugin turns this on for the "jxl-atlas" format.
+    void setAtlas(bool atlas);
+
+    // Counters and per-phase timings accumulated over the life of the handler.
+    // Timings (in nanoseconds) are only collected while info output is enabled for the
+    // qt.imageformats.jxl.stats logging category; they're zero otherwise.
+    struct DecodeStats
+    {
+        qint64 probeNs;            // Signature checks, in canRead() or in the plugin before creating us.
+        qint64 inputReadNs;        // Buffering the input file.
+        qint64 basicInfoNs;        // Decoding up to the basic info.
+        qint64 iccNs;              // Decoding and extracting the color profile.
+        QVector<qint64> frameNs;   // Most recent decode time of each frame, by frame number.
+        qint64 handoffNs;          // Wrapping pixels in QImages and attaching the color space.
+
+        qint64 bytesRead;
+        int framesDecoded;
+        int bufferAllocations;
+        int rewinds;
+    };
+    const DecodeStats& decodeStats() const;
+
 private:
 
     // Private structure to maintain state between calls to read()
@@ -42,6 +70,14 @@ private:
     };
     Progress _progress;
 
+    mutable DecodeStats _stats;  // Mutable so canRead() can record the probe.
+
+    bool _atlas;  // Format "jxl-atlas": read() returns all frames tiled into one image.
+
+    // Where the signature was last found to be valid; only compared, never dereferenced.
+    const QIODevice *_verifiedDevice;
+    qint64 _verifiedPos;
+
 
     void _init();
 
@@ -61,6 +97,14 @@ private:
     // Reset internal state so we can start decoding from the beginning.
     bool _rewind();
 
+    // Decode every frame straight into a grid in a single image.  A first pass reads just the frame
+    // headers to size the grid; a second decodes the pixels.
+    bool _readAtlas(QImage* destImage);
+
+    // Report the DecodeStats via the stats logging category, or as text keys on a decoded image.
+    void _logStats() const;
+    void _attachStats(QImage* image) const;
+
 };
 
 
@@ -20,23 +20,60 @@ QJxlPlugin::QJxlPlugin(QObject *parent)
 }
 
 
+/* The last successful signature check capabilities() made on this thread.  QImageReader calls create()
+ * right after a capabilities() call that said CanRead, whether it found us by file suffix (format "jxl")
+ * or by content (no format).  create() reuses the verdict and passes it on to the handler's canRead()
+ * instead of peeking again.  Every capabilities() call clears it first, so a verdict never outlives the
+ * probe it came from.  Only non-sequential devices are cached, since pos() means nothing for the others.
+ * The device is never dereferenced. */
+struct SniffResult
+{
+    const QIODevice *device;
+    qint64 pos;
+    qint64 probeNs;   // Time the check took, for the handler's stats.
+};
+static thread_local SniffResult lastSniff = {nullptr, 0, 0};
+
+
 QImageIOPlugin::Capabilities QJxlPlugin::capabilities(QIODevice *device, const QByteArray &format) const
 {
+    lastSniff.device = nullptr;
+
     if(device == nullptr)
-        return (format == "jxl") ? QImageIOPlugin::CanRead : Capabilities{};
+        return (format == "jxl" || format == "jxl-atlas") ? QImageIOPlugin::CanRead : Capabilities{};
 
-    return device->isReadable() && QJxlHandler::getReadableFormat(*device) == "jxl" ?
-                QImageIOPlugin::CanRead :
-                Capabilities{};
+    if(!device->isReadable())
+        return Capabilities{};
+
+    qint64 probeNs = 0;
+    const bool jxl = QJxlHandler::hasJxlSignature(*device, &probeNs);
+    if(jxl && !device->isSequential())
+        lastSniff = {device, device->pos(), probeNs};
+
+    return jxl ? QImageIOPlugin::CanRead : Capabilities{};
 }
 
 QImageIOHandler *QJxlPlugin::create(QIODevice *device, const QByteArray &format) const
 {
-    if(format == "jxl" || (format.isEmpty() && this->capabilities(device, "jxl") != 0))
+    // Use capabilities()' verdict if it was for this device at this position, and only once
+    const bool cached = device != nullptr && device == lastSniff.device &&
+                        !device->isSequential() && device->pos() == lastSniff.pos;
+    qint64 probeNs = cached ? lastSniff.probeNs : 0;
+    bool jxl = cached;
+    lastSniff.device = nullptr;
+
+    if(format.isEmpty() && !cached)
+        jxl = device == nullptr || (device->isReadable() && QJxlHandler::hasJxlSignature(*device, &probeNs));
+
+    const bool atlas = format == "jxl-atlas";
+    if(format == "jxl" || atlas || (format.isEmpty() && jxl))
     {
         QJxlHandler *hand = new QJxlHandler;
         hand->setDevice(device);
         hand->setFormat(format);
+        hand->setAtlas(atlas);
+        if(jxl)
+            hand->setSignatureVerified(probeNs);
         return hand;
     }
     return nullptr;